@@ -0,0 +1,54 @@
+/**
+ * Heap allocations per message for JSON::tryParse and a warm JSON::Parser,
+ * with and without malformed messages in between.
+ * g++ -std=c++17 -O2 -o allocations benchmark/allocations.cpp
+ */
+#include "../src/json.cpp"
+#include "counting-new.hpp"
+#include <iostream>
+#include <chrono>
+
+std::string message(int k)
+{
+	return "{\"jsonrpc\":\"2.0\",\"id\":" + std::to_string(k) + ",\"method\":\"account.update_profile\",\"params\":{\"user\":\"user-" +
+		   std::to_string(k % 1000) + "\",\"tags\":[\"a\",\"bb\",\"ccc\"],\"score\":" + std::to_string(k % 97) +
+		   ".5,\"active\":true,\"nickname\":\"a somewhat longer nickname value\"}}";
+}
+
+template <typename F>
+void measure(const char *name, const std::vector<std::string> &messages, int rounds, F parse)
+{
+	for (const auto &text : messages) // warm up
+		parse(text);
+	allocations = 0;
+	auto start = std::chrono::steady_clock::now();
+	for (int round = 0; round < rounds; round++)
+		for (const auto &text : messages)
+			parse(text);
+	auto end = std::chrono::steady_clock::now();
+	double count = double(rounds) * messages.size();
+	std::cout << name << ": " << std::chrono::duration<double, std::nano>(end - start).count() / count << " ns/msg, "
+			  << allocations / count << " allocations/msg" << std::endl;
+}
+
+int main()
+{
+	std::vector<std::string> good, mixed;
+	for (int k = 0; k < 1000; k++)
+	{
+		good.push_back(message(k * 7919));
+		mixed.push_back(good.back());
+		if (k % 10 == 0) // a truncated message, failing with containers still open, and a duplicate key
+			mixed.push_back(good.back().substr(0, good.back().size() / 2));
+		if (k % 10 == 5)
+			mixed.push_back("{\"a\":[1,2],\"a\":{\"b\":[\"c\"]},\"x\":[");
+	}
+	const int rounds = 200;
+	size_t sink = 0;
+	JSON::Parser parser;
+	measure("JSON::tryParse         ", good, rounds, [&](const std::string &text) { sink += JSON::tryParse(text).error.position; });
+	measure("JSON::Parser           ", good, rounds, [&](const std::string &text) { sink += parser.tryParse(text).error.position; });
+	measure("JSON::tryParse, errors ", mixed, rounds, [&](const std::string &text) { sink += JSON::tryParse(text).error.position; });
+	measure("JSON::Parser, errors   ", mixed, rounds, [&](const std::string &text) { sink += parser.tryParse(text).error.position; });
+	return sink == 0;
+}
@@ -0,0 +1,29 @@
+/**
+ * Replaces the global operator new and delete to count heap allocations, for the benchmarks.
+ * Include it in exactly one translation unit.
+ */
+#pragma once
+#include <new>
+#include <cstdlib>
+#include <cstddef>
+
+static size_t allocations = 0; // calls to operator new
+static size_t allocated = 0;   // bytes asked for
+
+void *operator new(size_t size)
+{
+	allocations++;
+	allocated += size;
+	if (void *p = std::malloc(size ? size : 1))
+		return p;
+	throw std::bad_alloc();
+}
+// kept out of line, so the compiler does not pair the free below with the allocator's new
+#ifdef __GNUC__
+__attribute__((noinline))
+#endif
+void operator delete(void *p) noexcept
+{
+	std::free(p);
+}
+void operator delete(void *p, size_t) noexcept { operator delete(p); }
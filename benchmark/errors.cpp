@@ -0,0 +1,45 @@
+/**
+ * Cost of a failed parse: JSON::parse throwing a JSON::SyntaxError against JSON::tryParse returning the error,
+ * for a flat malformed object and a malformed value 64 arrays deep.
+ * g++ -std=c++17 -O2 -o errors benchmark/errors.cpp
+ */
+#include "../src/json.cpp"
+#include <iostream>
+#include <chrono>
+
+template <typename F>
+double measure(int count, F parse)
+{
+	auto start = std::chrono::steady_clock::now();
+	for (int k = 0; k < count; k++)
+		parse();
+	auto end = std::chrono::steady_clock::now();
+	return std::chrono::duration<double, std::nano>(end - start).count() / count;
+}
+
+int main()
+{
+	std::string flat = "{\"id\":12,\"name\":\"abc\",\"tags\":[1,2,x]}";
+	std::string deep = std::string(64, '[') + "1,x" + std::string(64, ']');
+	const int count = 200000;
+	size_t sink = 0;
+	for (auto *text : {&flat, &deep})
+	{
+		double thrown = measure(count, [&]
+								{
+									try
+									{
+										JSON::parse(*text);
+									}
+									catch (const JSON::SyntaxError &e)
+									{
+										sink += e.what()[0];
+									}
+								});
+		double returned = measure(count, [&]
+								  { sink += JSON::tryParse(*text).error.position; });
+		std::cout << (text == &flat ? "flat object:   " : "64-deep array: ") << "throw " << thrown << " ns/doc, tryParse " << returned << " ns/doc"
+				  << std::endl;
+	}
+	return sink == 0;
+}
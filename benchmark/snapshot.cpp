@@ -0,0 +1,78 @@
+/**
+ * Latency and heap bytes of a snapshot-and-update cycle on a large config, with the shared nodes of JSON::Value
+ * (an O(1) copy, then setIn copying only the path) against taking the snapshot as a deep copy.
+ * g++ -std=c++17 -O2 -o snapshot benchmark/snapshot.cpp
+ */
+#include "../src/json.cpp"
+#include "counting-new.hpp"
+#include <iostream>
+#include <chrono>
+
+//! a copy sharing no node with value, what copying a Value did before nodes were shared
+JSON::Value deepCopy(const JSON::Value &value)
+{
+	switch (value.getType())
+	{
+	case JSON::Type::string:
+		return JSON::Value(JSON::String(value.getStringRef()));
+	case JSON::Type::array:
+	{
+		JSON::Array array;
+		array.reserve(value.getArrayRef().size());
+		for (const auto &item : value.getArrayRef())
+			array.push_back(deepCopy(item));
+		return JSON::Value(std::move(array));
+	}
+	case JSON::Type::object:
+	{
+		JSON::Object object;
+		for (const auto &member : value.getObjectRef())
+			object.emplace(member.first, deepCopy(member.second));
+		return JSON::Value(std::move(object));
+	}
+	default:
+		return value;
+	}
+}
+
+template <typename F>
+void measure(const char *name, int cycles, F cycle)
+{
+	allocated = 0;
+	auto start = std::chrono::steady_clock::now();
+	for (int k = 0; k < cycles; k++)
+		cycle(k);
+	auto end = std::chrono::steady_clock::now();
+	std::cout << name << ": " << std::chrono::duration<double, std::micro>(end - start).count() / cycles << " us, "
+			  << allocated / cycles / 1024 << " KB allocated per cycle" << std::endl;
+}
+
+int main()
+{
+	// 200 sections of 500 string keys
+	std::string text = "{";
+	for (int section = 0; section < 200; section++)
+	{
+		text += (section ? ",\"section" : "\"section") + std::to_string(section) + "\":{";
+		for (int key = 0; key < 500; key++)
+			text += (key ? ",\"key" : "\"key") + std::to_string(key) + "\":\"value number " + std::to_string(key) + " with some text\"";
+		text += "}";
+	}
+	text += "}";
+	JSON::Value config = JSON::parse(text);
+	size_t sink = 0;
+
+	measure("shared nodes, snapshot + setIn", 2000, [&](int k)
+			{
+				JSON::Value snapshot = config;
+				config = config.setIn({"section" + std::to_string(k % 200), "key" + std::to_string(k % 500)}, JSON::Value(double(k)));
+				sink += snapshot.getObjectRef().size();
+			});
+	measure("deep copy, snapshot + setIn   ", 20, [&](int k)
+			{
+				JSON::Value snapshot = deepCopy(config);
+				config = config.setIn({"section" + std::to_string(k % 200), "key" + std::to_string(k % 500)}, JSON::Value(double(k)));
+				sink += snapshot.getObjectRef().size();
+			});
+	return sink == 0;
+}
@@ -0,0 +1,59 @@
+/**
+ * Throughput of JSON::validate, of the UTF-8 check it starts with and of JSON::tryParse for comparison.
+ * Best of several interleaved runs.
+ * g++ -std=c++17 -O2 -o validate benchmark/validate.cpp
+ */
+#include "../src/json.cpp"
+#include <iostream>
+#include <chrono>
+#include <algorithm>
+
+std::string document(size_t records, bool cjk)
+{
+	std::string text = "[";
+	for (size_t k = 0; k < records; k++)
+	{
+		if (k)
+			text += ",";
+		text += "{\"id\":" + std::to_string(k * 7919 % 100000) + ",\"name\":\"user name number " + std::to_string(k) + (cjk ? " 你好世界" : "") +
+				"\",\"score\":" + std::to_string(k % 10000 / 100.0) + ",\"active\":" + (k % 3 ? "true" : "false") +
+				",\"tags\":[\"alpha\",\"beta\",\"gamma\"],\"bio\":\"" +
+				(cjk ? "敏捷的棕色狐狸跳过了懒狗，这是一段用于测试的较长文本。" : "Lorem ipsum dolor sit amet, consectetur adipiscing elit, sed do eiusmod tempor.") +
+				"\",\"address\":{\"city\":\"Springfield\",\"zip\":\"12345\",\"geo\":[12.5,-7.25]}}";
+	}
+	return text + "]";
+}
+
+int main()
+{
+	const int runs = 7;
+	JSON::ParseOptions options;
+	for (bool cjk : {false, true})
+	{
+		std::string text = document(50000, cjk);
+		double utf8 = 0, validate = 0, parse = 0; // best GB/s
+		size_t sink = 0;
+		auto measure = [&](double &best, bool (*check)(const std::string &, const JSON::ParseOptions &))
+		{
+			auto start = std::chrono::steady_clock::now();
+			sink += check(text, options);
+			auto end = std::chrono::steady_clock::now();
+			best = std::max(best, text.size() / std::chrono::duration<double, std::nano>(end - start).count());
+		};
+		for (int run = 0; run < runs; run++)
+		{
+			measure(utf8, [](const std::string &text, const JSON::ParseOptions &options)
+					{
+						JSON::ParseError error;
+						return JSON::checkInput(text, error, options, true);
+					});
+			measure(validate, [](const std::string &text, const JSON::ParseOptions &options)
+					{ return JSON::validate(text, options); });
+			measure(parse, [](const std::string &text, const JSON::ParseOptions &options)
+					{ return bool(JSON::tryParse(text, options)); });
+		}
+		std::cout << (cjk ? "CJK  " : "ASCII") << " " << text.size() / 1000000 << " MB: UTF-8 check " << utf8 << " GB/s, JSON::validate "
+				  << validate << " GB/s, JSON::tryParse " << parse << " GB/s" << (sink == 3 * runs ? "" : " (rejected!)") << std::endl;
+	}
+	return 0;
+}
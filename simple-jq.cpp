@@ -6,16 +6,15 @@
 #include <string>
 #include <vector>
 #include <stdexcept>
+#include <algorithm>
 
 using std::string, std::stringstream, std::cin, std::cout, std::vector, std::getline, std::stoi, std::to_string;
 
 string read_from_stdin()
 {
-	string s;
-	char ch;
-	while ((ch = cin.get()) != EOF)
-		s += ch;
-	return s;
+	stringstream ss;
+	ss << cin.rdbuf();
+	return ss.str();
 }
 
 string read_first_argv(int argc, char **argv, int index = 0)
@@ -105,8 +104,80 @@ JSON::Value get_final_value(JSON::Value json, vector<string> props)
 	return final;
 }
 
+// several paths (or one with *) in a single pass, one match per line as `path<TAB>value` or as JSON Lines.
+// a value matched by several paths is printed once; a path without * which matches nothing is an error
+int run_query(const string &input, const vector<string> &paths, bool jsonl)
+{
+	JSON::Query query(paths);
+	JSON::ParseError error;
+	string line, lastAt;
+	vector<bool> matched(paths.size(), false);
+	vector<size_t> atLast; // paths which matched lastAt; the matches of one value come in a row, each path once
+	auto emit = [&](size_t path, const JSON::String &at, const JSON::Value &value)
+	{
+		matched[path] = true;
+		bool again = at == lastAt && std::find(atLast.begin(), atLast.end(), path) == atLast.end();
+		if (!again)
+		{
+			lastAt = at;
+			atLast.clear();
+		}
+		atLast.push_back(path);
+		if (again)
+			return; // the same value as the line before, matched by another path
+		line.clear();
+		if (jsonl)
+		{
+			line += "{\"path\":";
+			JSON::stringifyString(line, at);
+			line += ",\"value\":";
+			JSON::stringifyValue(line, value, 0, false, 0);
+			line += '}';
+		}
+		else
+		{
+			line += at;
+			line += '\t';
+			JSON::stringifyValue(line, value, 0, false, 0);
+		}
+		line += '\n';
+		cout << line;
+	};
+	if (!query.run(input, emit, error))
+	{
+		cout << std::endl
+			 << error.message();
+		return 1;
+	}
+	int status = 0;
+	for (size_t path = 0; path < paths.size(); path++)
+		if (!matched[path] && paths[path].find('*') == string::npos)
+		{
+			std::cerr << "Path `" << paths[path] << "` matches nothing" << std::endl;
+			status = 1;
+		}
+	return status;
+}
+
 int main(int argc, char **argv)
 {
+	vector<string> paths;
+	bool jsonl = false, tsv = false;
+	for (int i = 1; i < argc; i++)
+	{
+		string arg = argv[i];
+		if (arg == "--jsonl")
+			jsonl = true;
+		else if (arg == "--tsv")
+			tsv = true;
+		else
+			paths.push_back(arg);
+	}
+	if (paths.empty())
+		paths.push_back(""); // the whole document
+	if (jsonl || tsv || paths.size() > 1 || (paths.size() == 1 && paths[0].find('*') != string::npos))
+		return run_query(read_from_stdin(), paths, jsonl);
+
 	try
 	{
 		auto cmd = read_first_argv(argc, argv);
@@ -1,4 +1,17 @@
 #include <string>
+#include <cstring>
+#include <cstdint>
+#include <cstdlib>
+#include <cerrno>
+#include <charconv> // defines __cpp_lib_to_chars when from_chars handles double
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define JSON_HAS_SSE2
+#endif
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
 
 namespace JSON
 {
@@ -110,4 +123,174 @@ namespace JSON
 			; // incorrect unicode (< 0 or > 2147483647)
 		return "";
 	}
+
+	//! convert the number text [first, last), which is known to be well formed and followed by a '\0' or a non-number char.
+	// false if it is out of the range of a double. from_chars for double needs GCC 11 or a recent libc++/MSVC,
+	// older ones use strtod, which follows the C locale's decimal point
+	inline bool convertNumber(const char *first, const char *last, double &number) noexcept
+	{
+#if defined(__cpp_lib_to_chars)
+		return std::from_chars(first, last, number).ec == std::errc();
+#else
+		(void)last; // strtod stops at the same char for well formed JSON numbers
+		errno = 0;
+		number = std::strtod(first, nullptr);
+		return errno != ERANGE;
+#endif
+	}
+
+	inline unsigned countTrailingZeros(unsigned mask)
+	{
+#if defined(_MSC_VER)
+		unsigned long index;
+		_BitScanForward(&index, mask);
+		return index;
+#else
+		return __builtin_ctz(mask);
+#endif
+	}
+
+	//! index of the first '"', '\' or control char (below 0x20) at or after i, or length if there is none
+	inline size_t findStringSpecial(const char *data, size_t i, size_t length) noexcept
+	{
+#ifdef JSON_HAS_SSE2
+		const __m128i quote = _mm_set1_epi8('"');
+		const __m128i backslash = _mm_set1_epi8('\\');
+		const __m128i control = _mm_set1_epi8(0x1F);
+		for (; i + 16 <= length; i += 16)
+		{
+			__m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + i));
+			// max(chunk, 0x1F) == 0x1F holds exactly for the bytes below 0x20
+			__m128i hit = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(chunk, quote), _mm_cmpeq_epi8(chunk, backslash)),
+									   _mm_cmpeq_epi8(_mm_max_epu8(chunk, control), control));
+			unsigned mask = _mm_movemask_epi8(hit);
+			if (mask)
+				return i + countTrailingZeros(mask);
+		}
+#endif
+		for (; i < length; i++)
+		{
+			unsigned char ch = data[i];
+			if (ch == '"' || ch == '\\' || ch < 0x20)
+				return i;
+		}
+		return length;
+	}
+
+	//! index of the first char at or after i which stringify has to escape, or length if there is none
+	inline size_t findEscapeNeeded(const char *data, size_t i, size_t length, bool ensure_ascii) noexcept
+	{
+#ifdef JSON_HAS_SSE2
+		const __m128i quote = _mm_set1_epi8('"');
+		const __m128i backslash = _mm_set1_epi8('\\');
+		const __m128i control = _mm_set1_epi8(0x1F);
+		for (; i + 16 <= length; i += 16)
+		{
+			__m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + i));
+			// max(chunk, 0x1F) == 0x1F holds exactly for the bytes below 0x20
+			__m128i hit = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(chunk, quote), _mm_cmpeq_epi8(chunk, backslash)),
+									   _mm_cmpeq_epi8(_mm_max_epu8(chunk, control), control));
+			unsigned mask = _mm_movemask_epi8(hit);
+			if (ensure_ascii)
+				mask |= _mm_movemask_epi8(chunk);
+			if (mask)
+				return i + countTrailingZeros(mask);
+		}
+#endif
+		for (; i < length; i++)
+		{
+			unsigned char ch = data[i];
+			if (ch == '"' || ch == '\\' || ch < 0x20 || (ensure_ascii && ch >= 0x80))
+				return i;
+		}
+		return length;
+	}
+
+	//! length of the well-formed UTF-8 sequence (Unicode Table 3-7) starting at s, 0 if it is malformed
+	inline size_t utf8SequenceLength(const unsigned char *s, size_t available) noexcept
+	{
+		unsigned char c = s[0];
+		if (c < 0x80)
+			return 1;
+		size_t length;
+		unsigned char low = 0x80, high = 0xBF; // allowed range of the second byte
+		if (c >= 0xC2 && c <= 0xDF)
+			length = 2;
+		else if (c >= 0xE0 && c <= 0xEF)
+		{
+			length = 3;
+			if (c == 0xE0)
+				low = 0xA0; // overlong
+			else if (c == 0xED)
+				high = 0x9F; // surrogates
+		}
+		else if (c >= 0xF0 && c <= 0xF4)
+		{
+			length = 4;
+			if (c == 0xF0)
+				low = 0x90; // overlong
+			else if (c == 0xF4)
+				high = 0x8F; // above U+10FFFF
+		}
+		else
+			return 0;
+		if (available < length || s[1] < low || s[1] > high)
+			return 0;
+		for (size_t k = 2; k < length; k++)
+			if ((s[k] & 0xC0) != 0x80)
+				return 0;
+		return length;
+	}
+
+	//! offset of the first byte which does not start a valid UTF-8 sequence, or length if all of it is valid
+	size_t findInvalidUtf8(const char *data, size_t length) noexcept
+	{
+		const unsigned char *s = reinterpret_cast<const unsigned char *>(data);
+		size_t i = 0;
+		while (i < length)
+		{
+			// skip ASCII in bulk, only the blocks holding multi-byte sequences are decoded one by one
+			size_t blockEnd = length;
+#ifdef JSON_HAS_SSE2
+			while (i + 64 <= length)
+			{
+				const __m128i *p = reinterpret_cast<const __m128i *>(s + i);
+				__m128i any = _mm_or_si128(_mm_or_si128(_mm_loadu_si128(p), _mm_loadu_si128(p + 1)),
+										   _mm_or_si128(_mm_loadu_si128(p + 2), _mm_loadu_si128(p + 3)));
+				if (_mm_movemask_epi8(any))
+					break;
+				i += 64;
+			}
+			for (; i + 16 <= length; i += 16)
+			{
+				unsigned mask = _mm_movemask_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i *>(s + i)));
+				if (mask)
+				{
+					blockEnd = i + 16;
+					i += countTrailingZeros(mask);
+					break;
+				}
+			}
+#else
+			for (; i + 8 <= length; i += 8)
+			{
+				uint64_t word;
+				memcpy(&word, s + i, 8);
+				if (word & 0x8080808080808080ULL)
+				{
+					blockEnd = i + 8;
+					break;
+				}
+			}
+#endif
+			while (i < blockEnd)
+			{
+				size_t n = utf8SequenceLength(s + i, length - i);
+				if (n == 0)
+					return i;
+				i += n;
+			}
+		}
+		return length;
+	}
 }
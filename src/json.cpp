@@ -2,342 +2,1202 @@
 
 namespace JSON
 {
-	Value parse(const std::string &str)
+	std::string ParseError::message() const
+	{
+		switch (code)
+		{
+		case ErrorCode::none:
+			return "";
+		case ErrorCode::unexpected_end:
+			return "Unexpected end of JSON input";
+		case ErrorCode::unexpected_token:
+			return std::string("Unexpected token ") + token + " in JSON at position " + std::to_string(position);
+		case ErrorCode::bad_control_character:
+			return std::string("Bad control character in string literal in JSON at position ") + std::to_string(position);
+		case ErrorCode::invalid_unicode_escape:
+			return "Invalid Unicode escape sequence";
+		case ErrorCode::expect_colon:
+			return "Expect ':' at " + std::to_string(position) + " but found " + token;
+		case ErrorCode::number_out_of_range:
+			return std::string("Number out of range in JSON at position ") + std::to_string(position);
+		case ErrorCode::invalid_utf8:
+			return std::string("Invalid UTF-8 sequence in JSON at position ") + std::to_string(position);
+		case ErrorCode::depth_limit_exceeded:
+			return std::string("Maximum nesting depth exceeded in JSON at position ") + std::to_string(position);
+		case ErrorCode::size_limit_exceeded:
+			return std::string("Maximum JSON input size exceeded at position ") + std::to_string(position);
+		default:
+			return "Unknown error";
+		}
+	}
+
+	//! record an error and unwind by returning false
+	inline bool fail(ParseError &error, ErrorCode code, size_t position, char token = '\0') noexcept
+	{
+		error.code = code;
+		error.position = position;
+		error.token = token;
+		return false;
+	}
+
+	//! report the char at i as unexpected, or the end of input if there is none
+	inline bool failAt(const std::string &str, size_t i, ParseError &error) noexcept
+	{
+		if (i >= str.length())
+			return fail(error, ErrorCode::unexpected_end, str.length());
+		return fail(error, ErrorCode::unexpected_token, i, str[i]);
+	}
+
+	//! fill in line and column, only done once parsing has failed
+	void locateError(const std::string &str, ParseError &error) noexcept
+	{
+		size_t end = std::min(error.position, str.length());
+		error.line = 1 + std::count(str.begin(), str.begin() + end, '\n');
+		size_t lineStart = str.rfind('\n', end == 0 ? 0 : end - 1);
+		error.column = (lineStart == std::string::npos || end == 0) ? end + 1 : end - lineStart;
+	}
+
+	//! checks done on the whole input before the grammar is looked at
+	bool checkInput(const std::string &str, ParseError &error, const ParseOptions &options, bool utf8) noexcept
+	{
+		if (options.max_size && str.length() > options.max_size)
+			return fail(error, ErrorCode::size_limit_exceeded, options.max_size);
+		if (utf8)
+		{
+			size_t invalid = findInvalidUtf8(str.data(), str.length());
+			if (invalid != str.length())
+				return fail(error, ErrorCode::invalid_utf8, invalid, str[invalid]);
+		}
+		return true;
+	}
+
+	//! parse (or with a null value, only check) a whole document
+	bool scanDocument(const std::string &str, Value *value, ParseError &error, const ParseOptions &options, bool utf8, ParseStack &stack) noexcept
 	{
 		size_t i = 0;
-		auto rst = parseValue(str, i);
+		if (!checkInput(str, error, options, utf8) || !scanValue(str, i, value, error, options, 0, stack))
+			return false;
 		skipBlank(str, i);
 		if (i != str.length())
-			throw SyntaxError("Unexpected end of JSON input");
-		return rst;
+			return fail(error, ErrorCode::unexpected_token, i, str[i]);
+		return true;
+	}
+
+	ParseResult tryParse(const std::string &str, const ParseOptions &options) noexcept
+	{
+		ParseResult result;
+		ParseStack stack;
+		if (!scanDocument(str, &result.value, result.error, options, options.validate_utf8, stack))
+			locateError(str, result.error);
+		return result;
+	}
+
+	Value parse(const std::string &str, const ParseOptions &options)
+	{
+		auto result = tryParse(str, options);
+		if (!result)
+			throw SyntaxError(result.error.message());
+		return result.value;
 	};
 
+	bool validate(const std::string &str, ParseError &error, const ParseOptions &options) noexcept
+	{
+		ParseStack stack;
+		if (scanDocument(str, nullptr, error, options, true, stack))
+			return true;
+		locateError(str, error);
+		return false;
+	}
+
+	bool validate(const std::string &str, const ParseOptions &options) noexcept
+	{
+		ParseError error;
+		return validate(str, error, options);
+	}
+
+	const ParseResult &Parser::tryParse(const std::string &str) noexcept
+	{
+		reset();
+		if (!scanDocument(str, &current.value, current.error, options, options.validate_utf8, stack))
+			locateError(str, current.error);
+		return current;
+	}
+
+	const Value &Parser::parse(const std::string &str)
+	{
+		if (!tryParse(str))
+			throw SyntaxError(current.error.message());
+		return current.value;
+	}
+
+	void Parser::reset() noexcept
+	{
+		stack.clear(); // containers left open by a failed parse
+		stack.reclaim(current.value);
+		current.error = ParseError();
+	}
+
+	void ParseStack::clear() noexcept
+	{
+		kinds.clear();
+		slots.clear();
+		// containers a failed parse left open go back to the free lists like any other result
+		Value open;
+		for (auto &node : arrays)
+		{
+			open.data_array = std::move(node);
+			open.type = Type::array;
+			reclaim(open);
+		}
+		for (auto &node : objects)
+		{
+			open.data_object = std::move(node);
+			open.type = Type::object;
+			reclaim(open);
+		}
+		arrays.clear();
+		objects.clear();
+		if (duplicate.data_string || duplicate.data_array || duplicate.data_object)
+			reclaim(duplicate);
+	}
+
+	void ParseStack::openContainer(char kind, Value *slot)
+	{
+		kinds.push_back(kind);
+		if (!slot)
+			return;
+		slots.push_back(slot);
+		if (kind == '[')
+		{
+			if (free_arrays.empty())
+				arrays.push_back(std::make_shared<Node<Array>>());
+			else
+			{
+				arrays.push_back(std::move(free_arrays.back()));
+				free_arrays.pop_back();
+			}
+		}
+		else
+		{
+			if (free_objects.empty())
+				objects.push_back(std::make_shared<Node<Object>>());
+			else
+			{
+				objects.push_back(std::move(free_objects.back()));
+				free_objects.pop_back();
+			}
+		}
+	}
+
+	void ParseStack::closeContainer(bool hashing) noexcept
+	{
+		char kind = kinds.back();
+		kinds.pop_back();
+		if (slots.empty())
+			return; // only checking
+		Value *target = slots.back();
+		slots.pop_back();
+		target->clear();
+		if (kind == '[')
+		{
+			target->data_array = std::move(arrays.back());
+			target->type = Type::array;
+			arrays.pop_back();
+		}
+		else
+		{
+			target->data_object = std::move(objects.back());
+			target->type = Type::object;
+			objects.pop_back();
+		}
+		if (hashing)
+			hash(*target); // the children are hashed already, so this only combines them
+	}
+
+	Value *ParseStack::appendElement()
+	{
+		return &arrays.back()->data.emplace_back();
+	}
+
+	Value *ParseStack::insertMember()
+	{
+		Object &object = objects.back()->data;
+		if (free_entries.empty())
+		{
+			auto inserted = object.try_emplace(key);
+			return inserted.second ? &inserted.first->second : &duplicate;
+		}
+		Object::node_type entry = std::move(free_entries.back());
+		free_entries.pop_back();
+		entry.key() = key; // fits the capacity of the old key most of the time
+		auto inserted = object.insert(std::move(entry));
+		if (inserted.inserted)
+			return &inserted.position->second;
+		free_entries.push_back(std::move(inserted.node));
+		return &duplicate;
+	}
+
+	std::shared_ptr<String> ParseStack::newString()
+	{
+		if (free_strings.empty())
+			return std::make_shared<String>();
+		auto string = std::move(free_strings.back());
+		free_strings.pop_back();
+		string->clear();
+		return string;
+	}
+
+	void ParseStack::setString(Value &target, std::shared_ptr<String> &&string) noexcept
+	{
+		target.clear();
+		target.data_string = std::move(string);
+		target.type = Type::string;
+	}
+
+	void ParseStack::reclaim(Value &value) noexcept
+	{
+		reclaiming.push_back(std::move(value));
+		while (!reclaiming.empty())
+		{
+			Value item = std::move(reclaiming.back());
+			reclaiming.pop_back();
+			// a node somebody else still holds is theirs, only the ones held here alone are emptied and kept.
+			// nodes are created non-const, so casting the const away is fine for their only owner
+			if (isSoleOwner(item.data_string))
+				free_strings.push_back(std::const_pointer_cast<String>(item.data_string));
+			else if (isSoleOwner(item.data_array))
+			{
+				auto node = std::const_pointer_cast<Node<Array>>(item.data_array);
+				for (auto &element : node->data)
+					reclaiming.push_back(std::move(element));
+				node->data.clear(); // keeps the capacity
+				node->cache.reset();
+				node->hash.store(0, std::memory_order_relaxed);
+				free_arrays.push_back(std::move(node));
+			}
+			else if (isSoleOwner(item.data_object))
+			{
+				auto node = std::const_pointer_cast<Node<Object>>(item.data_object);
+				while (!node->data.empty())
+				{
+					auto entry = node->data.extract(node->data.begin());
+					reclaiming.push_back(std::move(entry.mapped()));
+					free_entries.push_back(std::move(entry));
+				}
+				node->cache.reset();
+				node->hash.store(0, std::memory_order_relaxed);
+				free_objects.push_back(std::move(node));
+			}
+		}
+	}
+
 	void skipBlank(const std::string &str, size_t &i)
 	{
 		while (str[i] == ' ' || str[i] == '\n' || str[i] == '\r' || str[i] == '\t')
 			i++;
 	}
-	Value parseValue(const std::string &str, size_t &i)
+
+	bool scanValue(const std::string &str, size_t &i, Value *value, ParseError &error, const ParseOptions &options, size_t depth) noexcept
 	{
-		if (i > str.length())
-			throw SyntaxError("Unexpected end of JSON input");
-		Value value;
-		skipBlank(str, i);
-		if (str[i] == '{')
-			value.setObject(parseObject(str, i));
-		else if (str[i] == '[')
-			value.setArray(parseArray(str, i));
-		else if (str[i] == 'n')
-			value.setNull(parseNull(str, i));
-		else if (str[i] == 't')
-			value.setBoolean(parseTrue(str, i));
-		else if (str[i] == 'f')
-			value.setBoolean(parseFalse(str, i));
-		else if (str[i] == '"')
-			value.setString(parseString(str, i));
-		else if (isdigit(str[i]) || str[i] == '-')
-			value.setNumber(parseNumber(str, i));
-		else
-			throw SyntaxError(std::string("Unexpected token ") + (str[i]) + " in JSON at position " + std::to_string(i));
-		return value;
+		ParseStack stack;
+		return scanValue(str, i, value, error, options, depth, stack);
 	}
-	String parseString(const std::string &str, size_t &i)
+
+	//! scalar value at i into value (or only check it when value is null)
+	bool scanScalar(const std::string &str, size_t &i, Value *value, ParseError &error, ParseStack &stack) noexcept
 	{
-		String result;
-		i++; // skip left colon
-		while (str[i] != '"')
+		switch (str[i])
+		{
+		case 'n':
+		{
+			Null null;
+			if (!parseNull(str, i, null, error))
+				return false;
+			if (value)
+				value->setNull(std::move(null));
+			return true;
+		}
+		case 't':
+		case 'f':
 		{
-			if (str[i] == '\n')
-				throw SyntaxError(std::string("Bad control character in string literal in JSON at position ") + std::to_string(i));
+			Boolean boolean;
+			if (!(str[i] == 't' ? parseTrue(str, i, boolean, error) : parseFalse(str, i, boolean, error)))
+				return false;
+			if (value)
+				value->setBoolean(std::move(boolean));
+			return true;
+		}
+		case '"':
+		{
+			if (!value)
+				return scanString(str, i, nullptr, error);
+			auto string = stack.newString();
+			if (!scanString(str, i, string.get(), error))
+				return false;
+			stack.setString(*value, std::move(string));
+			return true;
+		}
+		default:
+		{
+			if (!isdigit((unsigned char)str[i]) && str[i] != '-')
+				return fail(error, ErrorCode::unexpected_token, i, str[i]);
+			Number number;
+			if (!scanNumber(str, i, value ? &number : nullptr, error))
+				return false;
+			if (value)
+				value->setNumber(std::move(number));
+			return true;
+		}
+		}
+	}
 
-			if (str[i] == '\\')
-			{
-				i++; // skip first '\'
+	//! step into the next element of the innermost open container, reading the key first for objects
+	inline bool scanElementStart(const std::string &str, size_t &i, ParseStack &stack, bool build, Value *&slot, ParseError &error) noexcept
+	{
+		if (stack.kinds.back() == '[')
+		{
+			slot = build ? stack.appendElement() : nullptr;
+			return true;
+		}
+		skipBlank(str, i); // skip blank to find key
+		if (str[i] != '"')
+			return failAt(str, i, error);
+		stack.key.clear();
+		if (!scanString(str, i, build ? &stack.key : nullptr, error))
+			return false;
+		skipBlank(str, i); // skip blank to find colon
+		if (i >= str.length())
+			return fail(error, ErrorCode::unexpected_end, str.length());
+		if (str[i] != ':')
+			return fail(error, ErrorCode::expect_colon, i, str[i]);
+		i++;
+		slot = build ? stack.insertMember() : nullptr;
+		return true;
+	}
 
-				if (strchr("/bfnrt\"", str[i]) != NULL)
+	bool scanValue(const std::string &str, size_t &i, Value *value, ParseError &error, const ParseOptions &options, size_t depth, ParseStack &stack) noexcept
+	{
+		// no recursion, nesting only grows the explicit stack so deep input can not overflow the call stack
+		const bool build = value != nullptr;
+		stack.clear();
+		Value *slot = value;
+		while (true)
+		{
+			skipBlank(str, i);
+			if (i >= str.length())
+				return fail(error, ErrorCode::unexpected_end, str.length());
+			char ch = str[i];
+			if (ch == '[' || ch == '{')
+			{
+				if (options.max_depth && depth + stack.kinds.size() >= options.max_depth)
+					return fail(error, ErrorCode::depth_limit_exceeded, i, ch);
+				stack.openContainer(ch, slot);
+				i++; // skip '[' or '{'
+				skipBlank(str, i);
+				if (str[i] != (ch == '[' ? ']' : '}'))
 				{
-					// there character should escaped with double backlash, so only one backslash is not allowed
-					throw SyntaxError(std::string("Unexpected token ") + (str[i]) + " in JSON at position " + std::to_string(i));
+					if (!scanElementStart(str, i, stack, build, slot, error))
+						return false;
+					continue;
 				}
-				else
+				// an empty container is closed right below
+			}
+			else if (!scanScalar(str, i, slot, error, stack))
+				return false;
+
+			// a value is complete: close the containers it completes, then step to the next element
+			while (true)
+			{
+				if (stack.kinds.empty())
+					return true;
+				skipBlank(str, i);
+				if (str[i] == (stack.kinds.back() == '[' ? ']' : '}'))
 				{
-					// check the char behind the first backlash
-					// if is a double backslash (or \uXXXX), then we need to parse it
-					// otherwise, simply append to result string
-					if (str[i] == '\\')
-					{
-						// here we match the escape char behind the first backlash
-						i++; // skip second '\'
-						switch (str[i])
-						{
-						case '"':
-							result += '"';
-							break;
-						case '\\':
-							result += "\\";
-							break;
-						case '/':
-							result += "/";
-							break;
-						case 'b':
-							result += "\b";
-							break;
-						case 'f':
-							result += "\f";
-							break;
-						case 'n':
-							result += "\n";
-							break;
-						case 'r':
-							result += "\r";
-							break;
-						case 't':
-							result += "\t";
-							break;
-						case 'u':
-						{
-							i++; // skip 'u'
-							String hexStr = str.substr(i, 4);
-							if (hexStr.length() != 4)
-								throw SyntaxError("Unexpected end of JSON input");
-							for (auto ch : hexStr)
-								if (!isHexChar(ch))
-									throw SyntaxError("Invalid Unicode escape sequence");
-							result += unicode_to_utf8(std::stoi(hexStr, 0, 16));
-							i += 3; // skip 3 hex digits, the rest 1 degit will be skip below (*)
-							break;
-						}
-						default:
-							throw SyntaxError(std::string("Unexpected token ") + (str[i]) + " in JSON at position " + std::to_string(i));
-						}
-						i++; // skip one escape char (*)
-					}		 // END IF
-					else if (str[i] == 'u')
-					{
-						i++; // skip 'u'
-						String hexStr = str.substr(i, 4);
-						if (hexStr.length() != 4)
-							throw SyntaxError("Unexpected end of JSON input");
-						for (auto ch : hexStr)
-							if (!isHexChar(ch))
-								throw SyntaxError("Invalid Unicode escape sequence");
-						result += unicode_to_utf8(std::stoi(hexStr, 0, 16));
-						i += 4; // skip 4 hex digits (for parsing unicode)
-					}
-					else
-					{
-						// if is not double backlash, no need to parse, simply append the char after the first backlash to the result
-						result += str[i];
-						i++;
-					} // END ELSE
-				}	  // END ELSE
-			}		  // END IF '\'
-			else
+					i++;
+					stack.closeContainer(options.hash_containers);
+					continue;
+				}
+				if (str[i] != ',')
+					return failAt(str, i, error);
+				i++; // skip sep_comma
+				break;
+			}
+			if (!scanElementStart(str, i, stack, build, slot, error))
+				return false;
+		}
+	}
+
+	//! read 4 hex digits at i as one UTF-16 code unit
+	inline bool scanHex4(const std::string &str, size_t &i, int &unit, ParseError &error) noexcept
+	{
+		if (i + 4 > str.length())
+			return fail(error, ErrorCode::unexpected_end, str.length());
+		unit = 0;
+		for (size_t k = i; k < i + 4; k++)
+		{
+			if (!isHexChar(str[k]))
+				return fail(error, ErrorCode::invalid_unicode_escape, k, str[k]);
+			unit = unit * 16 + (str[k] <= '9' ? str[k] - '0' : (str[k] | 0x20) - 'a' + 10);
+		}
+		i += 4;
+		return true;
+	}
+
+	//! read the rest of a \uXXXX escape, i points to the first digit.
+	// a high surrogate followed by a \u low surrogate is one code point, as stringify writes them with ensure_ascii.
+	// an unpaired surrogate is no character and has no UTF-8 form, so it is rejected
+	inline bool scanUnicodeEscape(const std::string &str, size_t &i, String *result, ParseError &error) noexcept
+	{
+		const size_t start = i - 2; // the '\'
+		int unicode;
+		if (!scanHex4(str, i, unicode, error))
+			return false;
+		if (unicode >= 0xDC00 && unicode <= 0xDFFF)
+			return fail(error, ErrorCode::invalid_unicode_escape, start);
+		if (unicode >= 0xD800 && unicode <= 0xDBFF)
+		{
+			if (str.compare(i, 2, "\\u") != 0)
+				return fail(error, ErrorCode::invalid_unicode_escape, start);
+			size_t k = i + 2;
+			int low;
+			if (!scanHex4(str, k, low, error))
+				return false;
+			if (low < 0xDC00 || low > 0xDFFF)
+				return fail(error, ErrorCode::invalid_unicode_escape, start);
+			unicode = 0x10000 + ((unicode - 0xD800) << 10) + (low - 0xDC00);
+			i = k;
+		}
+		if (result)
+			*result += unicode_to_utf8(unicode);
+		return true;
+	}
+
+	bool scanString(const std::string &str, size_t &i, String *result, ParseError &error) noexcept
+	{
+		const size_t length = str.length();
+		i++; // skip left colon
+		while (true)
+		{
+			// copy the run of plain chars in one go
+			size_t start = i;
+			i = findStringSpecial(str.data(), i, length);
+			if (result)
+				result->append(str, start, i - start);
+
+			if (i >= length)
+				return fail(error, ErrorCode::unexpected_end, length);
+			if (str[i] == '"')
+				break;
+			if ((unsigned char)str[i] < 0x20) // raw control chars have to be escaped
+				return fail(error, ErrorCode::bad_control_character, i);
+
+			i++; // skip '\'
+			if (i >= length)
+				return fail(error, ErrorCode::unexpected_end, length);
+			char unescaped;
+			switch (str[i])
 			{
-				// simply append to the result
-				result += str[i];
-				i++;
+			case '"':
+			case '\\':
+			case '/':
+				unescaped = str[i];
+				break;
+			case 'b':
+				unescaped = '\b';
+				break;
+			case 'f':
+				unescaped = '\f';
+				break;
+			case 'n':
+				unescaped = '\n';
+				break;
+			case 'r':
+				unescaped = '\r';
+				break;
+			case 't':
+				unescaped = '\t';
+				break;
+			case 'u':
+				i++; // skip 'u'
+				if (!scanUnicodeEscape(str, i, result, error))
+					return false;
+				continue;
+			default:
+				return fail(error, ErrorCode::unexpected_token, i, str[i]);
 			}
-		}	 // END WHILE
+			if (result)
+				*result += unescaped;
+			i++; // skip the escape char
+		}
 		i++; // skip right colon
-		return result;
+		return true;
 	}
 
-	Number parseNumber(const std::string &str, size_t &i)
+	bool scanNumber(const std::string &str, size_t &i, Number *result, ParseError &error) noexcept
 	{
-		std::string numStr = "";
+		const size_t length = str.length();
+		const size_t start = i;
+		bool hasDigits = false, hasExponent = false;
 		if (str[i] == '-')
-		{
-			numStr += '-';
 			i++;
-		}
-		while (isdigit(str[i]))
+		if (str[i] == '0' && isdigit((unsigned char)str[i + 1])) // no leading zeros, str[length] is '\0'
+			return fail(error, ErrorCode::unexpected_token, i + 1, str[i + 1]);
+		while (isdigit((unsigned char)str[i]))
 		{
-			numStr += str[i];
+			hasDigits = true;
 			i++;
 		}
-		if (str[i] == '.') // push '.' and push rest number
+		if (str[i] == '.') // skip '.' and the rest number
 		{
-			numStr += '.';
 			i++;
-			if (i >= str.length())
-				throw SyntaxError("Unexpected end of JSON input");
-			if (!isdigit(str[i]))
-				throw SyntaxError(std::string("Unexpected token ") + (str[i]) + " in JSON at position " + std::to_string(i));
-			while (isdigit(str[i]))
-			{
-				numStr += str[i];
+			if (i >= length)
+				return fail(error, ErrorCode::unexpected_end, length);
+			if (!isdigit((unsigned char)str[i]))
+				return fail(error, ErrorCode::unexpected_token, i, str[i]);
+			while (isdigit((unsigned char)str[i]))
 				i++;
-			}
+			hasDigits = true;
 		}
-		if (str[i] == 'e' || str[i] == 'E') // parse Scientific notation
+		if (!hasDigits)
+			return failAt(str, i, error);
+		if (str[i] == 'e' || str[i] == 'E') // Scientific notation
 		{
-			numStr += 'e';
+			hasExponent = true;
 			i++; // skip e/E
-			if (i >= str.length())
-				throw SyntaxError("Unexpected end of JSON input");
 			if (str[i] == '-' || str[i] == '+')
-			{
-				numStr += str[i];
 				i++;
-			}
-			if (i >= str.length())
-				throw SyntaxError("Unexpected end of JSON input");
-			if (!isdigit(str[i]))
-				throw SyntaxError(std::string("Unexpected token ") + (str[i]) + " in JSON at position " + std::to_string(i));
-			while (isdigit(str[i]))
-			{
-				numStr += str[i];
+			if (i >= length)
+				return fail(error, ErrorCode::unexpected_end, length);
+			if (!isdigit((unsigned char)str[i]))
+				return fail(error, ErrorCode::unexpected_token, i, str[i]);
+			while (isdigit((unsigned char)str[i]))
 				i++;
-			}
 		}
 
-		return std::stod(numStr);
+		// only an exponent or a few hundred digits can leave the range of a double, so checking skips the conversion otherwise
+		if (!result && !hasExponent && i - start < 300)
+			return true;
+		Number number;
+		if (!convertNumber(str.data() + start, str.data() + i, number))
+			return fail(error, ErrorCode::number_out_of_range, start);
+		if (result)
+			*result = number;
+		return true;
 	}
 
-	Null parseNull(const std::string &str, size_t &i)
+	bool parseNull(const std::string &str, size_t &i, Null &result, ParseError &error) noexcept
 	{
-		if (str.substr(i, 4) == "null")
+		if (str.compare(i, 4, "null") == 0)
 		{
 			i += 4;
-			return nullptr;
+			result = nullptr;
+			return true;
 		}
-		throw SyntaxError(std::string("Unexpected token ") + (str[i]) + " in JSON at position " + std::to_string(i));
+		return fail(error, ErrorCode::unexpected_token, i, str[i]);
 	}
 
-	Boolean parseTrue(const std::string &str, size_t &i)
+	bool parseTrue(const std::string &str, size_t &i, Boolean &result, ParseError &error) noexcept
 	{
-		if (str.substr(i, 4) == "true")
+		if (str.compare(i, 4, "true") == 0)
 		{
 			i += 4;
-			return (true);
+			result = true;
+			return true;
 		}
-		throw SyntaxError(std::string("Unexpected token ") + (str[i]) + " in JSON at position " + std::to_string(i));
+		return fail(error, ErrorCode::unexpected_token, i, str[i]);
 	}
 
-	Boolean parseFalse(const std::string &str, size_t &i)
+	bool parseFalse(const std::string &str, size_t &i, Boolean &result, ParseError &error) noexcept
 	{
-		if (str.substr(i, 5) == "false")
+		if (str.compare(i, 5, "false") == 0)
 		{
 			i += 5;
-			return (false);
+			result = false;
+			return true;
 		}
-		throw SyntaxError(std::string("Unexpected token ") + (str[i]) + " in JSON at position " + std::to_string(i));
+		return fail(error, ErrorCode::unexpected_token, i, str[i]);
 	}
 
-	Object parseObject(const std::string &str, size_t &i)
+	bool parseValue(const std::string &str, size_t &i, Value &value, ParseError &error) noexcept { return scanValue(str, i, &value, error, ParseOptions(), 0); }
+	bool parseString(const std::string &str, size_t &i, String &result, ParseError &error) noexcept
 	{
-		i++; // skip '{'
-		Object result;
-		while (str[i] != '}')
-		{
-			skipBlank(str, i); // skip blank to find key
-			std::string key = parseString(str, i);
-			skipBlank(str, i); // skip blank to find colon
-			if (str[i] == ':')
-				i++;
-			else
-				throw SyntaxError("Expect ':' at " + std::to_string(i) + " but found " + (str[i]));
-			auto value = parseValue(str, i);
-			auto entry = std::make_pair<String, Value>(std::move(key), std::move(value));
-			result.insert(std::move(entry));
-			skipBlank(str, i);
-			if (str[i] == ',')
-				i++; // skip sep_comma
-			else
-				skipBlank(str, i); // skip blank to find '}'
-		}
-		i++; // skip '}'
+		result.clear();
+		return scanString(str, i, &result, error);
+	}
+	bool parseNumber(const std::string &str, size_t &i, Number &result, ParseError &error) noexcept { return scanNumber(str, i, &result, error); }
+	bool parseObject(const std::string &str, size_t &i, Object &result, ParseError &error) noexcept
+	{
+		if (str[i] != '{')
+			return failAt(str, i, error);
+		Value value;
+		if (!parseValue(str, i, value, error))
+			return false;
+		result = value.getObjectRef();
+		return true;
+	}
+	bool parseArray(const std::string &str, size_t &i, Array &result, ParseError &error) noexcept
+	{
+		if (str[i] != '[')
+			return failAt(str, i, error);
+		Value value;
+		if (!parseValue(str, i, value, error))
+			return false;
+		result = value.getArrayRef();
+		return true;
+	}
+
+	//! throwing variants
+	template <typename T, typename F>
+	inline T parseOrThrow(const std::string &str, size_t &i, F parser)
+	{
+		T result;
+		ParseError error;
+		if (!parser(str, i, result, error))
+			throw SyntaxError(error.message());
 		return result;
 	}
-	Array parseArray(const std::string &str, size_t &i)
+
+	Value parseValue(const std::string &str, size_t &i) { return parseOrThrow<Value>(str, i, [](auto &s, auto &j, auto &r, auto &e) { return parseValue(s, j, r, e); }); }
+	String parseString(const std::string &str, size_t &i) { return parseOrThrow<String>(str, i, [](auto &s, auto &j, auto &r, auto &e) { return parseString(s, j, r, e); }); }
+	Null parseNull(const std::string &str, size_t &i) { return parseOrThrow<Null>(str, i, [](auto &s, auto &j, auto &r, auto &e) { return parseNull(s, j, r, e); }); }
+	Number parseNumber(const std::string &str, size_t &i) { return parseOrThrow<Number>(str, i, [](auto &s, auto &j, auto &r, auto &e) { return parseNumber(s, j, r, e); }); }
+	Boolean parseTrue(const std::string &str, size_t &i) { return parseOrThrow<Boolean>(str, i, [](auto &s, auto &j, auto &r, auto &e) { return parseTrue(s, j, r, e); }); }
+	Boolean parseFalse(const std::string &str, size_t &i) { return parseOrThrow<Boolean>(str, i, [](auto &s, auto &j, auto &r, auto &e) { return parseFalse(s, j, r, e); }); }
+	Object parseObject(const std::string &str, size_t &i) { return parseOrThrow<Object>(str, i, [](auto &s, auto &j, auto &r, auto &e) { return parseObject(s, j, r, e); }); }
+	Array parseArray(const std::string &str, size_t &i) { return parseOrThrow<Array>(str, i, [](auto &s, auto &j, auto &r, auto &e) { return parseArray(s, j, r, e); }); }
+
+	String stringify(const Value &value, unsigned int indent, bool ensure_ascii)
+	{
+		String out;
+		stringifyValue(out, value, indent, ensure_ascii, 0);
+		return out;
+	}
+
+	String stringifyCached(const Value &value, unsigned int indent, bool ensure_ascii)
 	{
-		i++;
-		Array result;
-		while (str[i] != ']')
+		String out;
+		stringifyValue(out, value, indent, ensure_ascii, 0, true);
+		return out;
+	}
+
+	//! start a new line indented for the given depth
+	inline void appendNewline(String &out, unsigned int indent, unsigned int depth)
+	{
+		out += '\n';
+		out.append(size_t(indent) * depth, ' ');
+	}
+
+	//! containers with shorter output are cheaper to serialize again than to keep
+	const size_t stringify_cache_threshold = 64;
+
+	//! append the cached output of node, or serialize it with emit and keep the result on the node
+	template <typename T, typename F>
+	void stringifyNode(String &out, const Node<T> &node, unsigned int indent, bool ensure_ascii, unsigned int depth, F emit)
+	{
+		// with indent the output depends on the depth, without it not at all
+		unsigned int cacheDepth = indent ? depth : 0;
+		auto cached = std::atomic_load(&node.cache);
+		if (cached && cached->indent == indent && cached->ensure_ascii == ensure_ascii && cached->depth == cacheDepth)
 		{
-			result.push_back(parseValue(str, i));
-			if (str[i] == ',')
-				i++; // skip sep_comma
-			else
-				skipBlank(str, i); // skip blank to find ']'
+			out += cached->bytes;
+			return;
 		}
-		i++; // skip ']'
-		return result;
+		size_t start = out.length();
+		emit();
+		if (out.length() - start < stringify_cache_threshold)
+			return;
+		auto fresh = std::make_shared<StringifyCache>();
+		fresh->indent = indent;
+		fresh->ensure_ascii = ensure_ascii;
+		fresh->depth = cacheDepth;
+		fresh->bytes.assign(out, start, String::npos);
+		std::atomic_store(&node.cache, std::shared_ptr<const StringifyCache>(std::move(fresh)));
 	}
 
-	String stringify(const Value &value, unsigned int indent)
+	void stringifyValue(String &out, const Value &value, unsigned int indent, bool ensure_ascii, unsigned int depth, bool cached)
 	{
 		switch (value.getType())
 		{
 		case Type::string:
-			return stringifyString(value.getString());
+			stringifyString(out, value.getStringRef(), ensure_ascii);
+			break;
 		case Type::number:
-			return stringifyNumber(value.getNumber());
+			out += stringifyNumber(value.getNumber());
+			break;
 		case Type::boolean:
-			return stringifyBoolean(value.getBoolean());
-		case Type::null:
-			return stringifyNull(value.getNull());
+			out += value.getBoolean() ? "true" : "false";
+			break;
 		case Type::array:
-			return stringifyArray(value.getArray(), indent);
+			if (cached)
+				stringifyNode(out, *value.data_array, indent, ensure_ascii, depth,
+							  [&]() { stringifyArray(out, value.data_array->data, indent, ensure_ascii, depth, true); });
+			else
+				stringifyArray(out, value.getArrayRef(), indent, ensure_ascii, depth);
+			break;
 		case Type::object:
-			return stringifyObject(value.getObject(), indent);
+			if (cached)
+				stringifyNode(out, *value.data_object, indent, ensure_ascii, depth,
+							  [&]() { stringifyObject(out, value.data_object->data, indent, ensure_ascii, depth, true); });
+			else
+				stringifyObject(out, value.getObjectRef(), indent, ensure_ascii, depth);
+			break;
 		default:
-			return "null";
+			out += "null";
 		}
 	}
 
-	String addIndent(const std::string &s, unsigned int indent = 0)
+	void stringifyArray(String &out, const Array &value, unsigned int indent, bool ensure_ascii, unsigned int depth, bool cached)
 	{
-		std::stringstream input, output;
-		input.str(s);
-		std::string item;
-		while (std::getline(input, item))
+		out += '[';
+		bool first = true;
+		for (const auto &item : value)
 		{
-			for (unsigned int i = 0; i < indent; i++)
-				output << ' ';
-			output << item << '\n';
+			if (!first)
+				out += ',';
+			first = false;
+			if (indent)
+				appendNewline(out, indent, depth + 1);
+			stringifyValue(out, item, indent, ensure_ascii, depth + 1, cached);
 		}
-		std::string out_str = output.str();
-		out_str.erase(out_str.length() - 1, 1);
-		return out_str;
+		if (indent && !value.empty())
+			appendNewline(out, indent, depth);
+		out += ']';
 	}
 
-	String stringifyArray(const Array &value, unsigned int indent)
+	void stringifyObject(String &out, const Object &value, unsigned int indent, bool ensure_ascii, unsigned int depth, bool cached)
 	{
-		String rst = "[";
-		for (auto item : value)
+		out += '{';
+		bool first = true;
+		for (const auto &item : value)
 		{
-			auto lines = stringify(item, indent);
+			if (!first)
+				out += ',';
+			first = false;
 			if (indent)
+				appendNewline(out, indent, depth + 1);
+			stringifyString(out, item.first, ensure_ascii);
+			out += indent ? ": " : ":";
+			stringifyValue(out, item.second, indent, ensure_ascii, depth + 1, cached);
+		}
+		if (indent && !value.empty())
+			appendNewline(out, indent, depth);
+		out += '}';
+	}
+
+	String stringifyArray(const Array &value, unsigned int indent, bool ensure_ascii)
+	{
+		String out;
+		stringifyArray(out, value, indent, ensure_ascii, 0);
+		return out;
+	}
+
+	String stringifyObject(const Object &value, unsigned int indent, bool ensure_ascii)
+	{
+		String out;
+		stringifyObject(out, value, indent, ensure_ascii, 0);
+		return out;
+	}
+
+	//! append \uXXXX for a code unit below 0x10000
+	inline void appendUnicodeEscape(String &out, unsigned int unit)
+	{
+		const char *hex = "0123456789abcdef";
+		char escape[6] = {'\\', 'u', hex[(unit >> 12) & 0xF], hex[(unit >> 8) & 0xF], hex[(unit >> 4) & 0xF], hex[unit & 0xF]};
+		out.append(escape, 6);
+	}
+
+	void stringifyString(String &out, const String &value, bool ensure_ascii)
+	{
+		const char *data = value.data();
+		const size_t length = value.length();
+		out.reserve(out.length() + length + 2);
+		out += '"';
+		size_t i = 0;
+		while (true)
+		{
+			// copy the run needing no escape in one go
+			size_t start = i;
+			i = findEscapeNeeded(data, i, length, ensure_ascii);
+			out.append(data + start, i - start);
+			if (i >= length)
+				break;
+
+			unsigned char ch = data[i];
+			switch (ch)
+			{
+			case '"':
+				out += "\\\"";
+				break;
+			case '\\':
+				out += "\\\\";
+				break;
+			case '\b':
+				out += "\\b";
+				break;
+			case '\f':
+				out += "\\f";
+				break;
+			case '\n':
+				out += "\\n";
+				break;
+			case '\r':
+				out += "\\r";
+				break;
+			case '\t':
+				out += "\\t";
+				break;
+			default:
+				if (ch < 0x20)
+				{
+					appendUnicodeEscape(out, ch);
+					break;
+				}
+				// ensure_ascii: escape the whole UTF-8 sequence, malformed bytes become U+FFFD
+				size_t n = utf8SequenceLength(reinterpret_cast<const unsigned char *>(data + i), length - i);
+				if (n == 0)
+				{
+					appendUnicodeEscape(out, 0xFFFD);
+					break;
+				}
+				unsigned int unicode = ch & (0xFF >> (n + 1));
+				for (size_t k = 1; k < n; k++)
+					unicode = (unicode << 6) | (data[i + k] & 0x3F);
+				if (unicode >= 0x10000)
+				{
+					unicode -= 0x10000;
+					appendUnicodeEscape(out, 0xD800 + (unicode >> 10));
+					appendUnicodeEscape(out, 0xDC00 + (unicode & 0x3FF));
+				}
+				else
+					appendUnicodeEscape(out, unicode);
+				i += n - 1;
+			}
+			i++;
+		}
+		out += '"';
+	}
+
+	Value Value::set(const String &key, Value value) const
+	{
+		Object object = getObjectRef(); // copies the direct children only, their nodes stay shared
+		object[key] = std::move(value);
+		return Value(std::move(object));
+	}
+
+	Value Value::set(size_t index, Value value) const
+	{
+		Array array = getArrayRef();
+		array.at(index) = std::move(value);
+		return Value(std::move(array));
+	}
+
+	Value Value::push(Value value) const
+	{
+		Array array = getArrayRef();
+		array.push_back(std::move(value));
+		return Value(std::move(array));
+	}
+
+	//! copy the nodes along path[from..] and let update replace the last one
+	template <typename F>
+	Value updateIn(const Value &node, const std::vector<String> &path, size_t from, F update)
+	{
+		if (from == path.size())
+			return update(node);
+		const String &segment = path[from];
+		if (node.getType() == Type::array)
+		{
+			if (segment.empty() || segment.find_first_not_of("0123456789") != String::npos)
+				throw TypeError("Key `" + segment + "` can not used for indexing array");
+			size_t index = std::stoul(segment);
+			return node.set(index, updateIn(node.getArrayRef().at(index), path, from + 1, update));
+		}
+		const Object &object = node.getObjectRef();
+		auto found = object.find(segment);
+		if (found != object.end())
+			return node.set(segment, updateIn(found->second, path, from + 1, update));
+		if (from + 1 == path.size())
+			return node.set(segment, update(Value()));
+		throw std::out_of_range("Key `" + segment + "` does not exist");
+	}
+
+	Value Value::setIn(const std::vector<String> &path, Value value) const
+	{
+		return updateIn(*this, path, 0, [&value](const Value &) { return value; });
+	}
+
+	Value Value::pushIn(const std::vector<String> &path, Value value) const
+	{
+		return updateIn(*this, path, 0, [&value](const Value &node) { return node.push(value); });
+	}
+
+	std::vector<String> Query::splitPath(const String &path)
+	{
+		std::vector<String> segments;
+		size_t start = (!path.empty() && path[0] == '.') ? 1 : 0;
+		if (start >= path.length())
+			return segments;
+		while (true)
+		{
+			size_t dot = path.find('.', start);
+			segments.push_back(path.substr(start, dot == String::npos ? String::npos : dot - start));
+			if (dot == String::npos)
+				return segments;
+			start = dot + 1;
+		}
+	}
+
+	Query::Query(const std::vector<String> &paths)
+	{
+		nodes.emplace_back();
+		for (size_t index = 0; index < paths.size(); index++)
+		{
+			size_t node = 0;
+			for (const auto &segment : splitPath(paths[index]))
 			{
-				rst.append("\n");
-				lines = addIndent(lines, indent);
+				size_t next = no_node;
+				if (segment == "*")
+					next = nodes[node].wildcard;
+				else if (nodes[node].children.count(segment))
+					next = nodes[node].children.at(segment);
+				if (next == no_node)
+				{
+					next = nodes.size();
+					nodes.emplace_back(); // may move nodes, so index again below
+					if (segment == "*")
+						nodes[node].wildcard = next;
+					else
+						nodes[node].children[segment] = next;
+				}
+				node = next;
 			}
-			rst.append(lines);
-			rst.append(",");
+			nodes[node].paths.push_back(index);
+		}
+	}
+
+	//! trie nodes reached from states by a key or index, both the exact match and *
+	void Query::step(const std::vector<size_t> &states, const String &segment, std::vector<size_t> &next) const
+	{
+		next.clear();
+		for (size_t state : states)
+		{
+			auto found = nodes[state].children.find(segment);
+			if (found != nodes[state].children.end())
+				next.push_back(found->second);
+			if (nodes[state].wildcard != no_node)
+				next.push_back(nodes[state].wildcard);
+		}
+	}
+
+	bool Query::run(const std::string &str, const Emit &emit, ParseError &error, const ParseOptions &options) const
+	{
+		String at;
+		ParseStack stack;
+		size_t i = 0;
+		if (checkInput(str, error, options, options.validate_utf8) && walk(str, i, {0}, at, emit, error, options, 0, stack))
+		{
+			skipBlank(str, i);
+			if (i == str.length())
+				return true;
+			fail(error, ErrorCode::unexpected_token, i, str[i]);
 		}
-		rst.erase(rst.length() - 1, 1);
-		rst.append(indent ? "\n]" : "]");
-		return rst;
+		locateError(str, error);
+		return false;
 	}
 
-	String stringifyObject(const Object &value, unsigned int indent)
+	void Query::run(const Value &value, const Emit &emit) const
 	{
-		String rst = "{";
-		for (auto item : value)
+		String at;
+		match(value, {0}, at, emit);
+	}
+
+	//! append the segment for a key or index to the concrete path
+	inline void appendSegment(String &at, const String &segment)
+	{
+		if (!at.empty())
+			at += '.';
+		at += segment;
+	}
+
+	bool Query::walk(const std::string &str, size_t &i, const std::vector<size_t> &states, String &at, const Emit &emit, ParseError &error, const ParseOptions &options, size_t depth, ParseStack &stack) const
+	{
+		skipBlank(str, i);
+		bool matched = false, below = false;
+		for (size_t state : states)
+		{
+			matched = matched || !nodes[state].paths.empty();
+			below = below || !nodes[state].children.empty() || nodes[state].wildcard != no_node;
+		}
+		if (matched)
 		{
-			auto kv_string = stringifyString(item.first) + (indent ? ": " : ":") + stringify(item.second, indent);
-			if (indent > 0)
+			// build only the matched value, longer paths below it are looked up in what was built
+			Value value;
+			if (!scanValue(str, i, &value, error, options, depth, stack))
+				return false;
+			match(value, states, at, emit);
+			return true;
+		}
+		if (!below || i >= str.length() || (str[i] != '{' && str[i] != '['))
+			return scanValue(str, i, nullptr, error, options, depth, stack); // nothing below matches, only check it
+
+		if (options.max_depth && depth >= options.max_depth)
+			return fail(error, ErrorCode::depth_limit_exceeded, i, str[i]);
+		const bool isObject = str[i] == '{';
+		const char closer = isObject ? '}' : ']';
+		i++; // skip '{' or '['
+		skipBlank(str, i);
+		if (str[i] == closer)
+		{
+			i++;
+			return true;
+		}
+		size_t length = at.length();
+		String key;
+		std::vector<size_t> next;
+		for (size_t index = 0;; index++)
+		{
+			if (isObject)
 			{
-				rst.append("\n");
-				kv_string = addIndent(kv_string, indent);
+				skipBlank(str, i); // skip blank to find key
+				if (str[i] != '"')
+					return failAt(str, i, error);
+				key.clear();
+				if (!scanString(str, i, &key, error))
+					return false;
+				skipBlank(str, i); // skip blank to find colon
+				if (i >= str.length())
+					return fail(error, ErrorCode::unexpected_end, str.length());
+				if (str[i] != ':')
+					return fail(error, ErrorCode::expect_colon, i, str[i]);
+				i++;
 			}
-			rst.append(kv_string);
-			rst.append(",");
+			else
+				key = std::to_string(index);
+			step(states, key, next);
+			appendSegment(at, key);
+			bool ok = next.empty() ? scanValue(str, i, nullptr, error, options, depth + 1, stack)
+								   : walk(str, i, next, at, emit, error, options, depth + 1, stack);
+			at.resize(length);
+			if (!ok)
+				return false;
+			skipBlank(str, i);
+			if (str[i] == ',')
+				i++; // skip sep_comma
+			else if (str[i] == closer)
+				break;
+			else
+				return failAt(str, i, error);
+		}
+		i++; // skip closer
+		return true;
+	}
+
+	void Query::match(const Value &value, const std::vector<size_t> &states, String &at, const Emit &emit) const
+	{
+		for (size_t state : states)
+			for (size_t path : nodes[state].paths)
+				emit(path, at, value);
+		if (value.getType() != Type::object && value.getType() != Type::array)
+			return;
+		size_t length = at.length();
+		std::vector<size_t> next;
+		auto visit = [&](const String &segment, const Value &item)
+		{
+			step(states, segment, next);
+			if (next.empty())
+				return;
+			appendSegment(at, segment);
+			match(item, std::vector<size_t>(next), at, emit);
+			at.resize(length);
+		};
+		if (value.getType() == Type::object)
+			for (const auto &item : value.getObjectRef())
+				visit(item.first, item.second);
+		else
+		{
+			const Array &array = value.getArrayRef();
+			for (size_t index = 0; index < array.size(); index++)
+				visit(std::to_string(index), array[index]);
+		}
+	}
+
+	inline size_t hashCombine(size_t seed, size_t value) noexcept
+	{
+		return seed ^ (value + size_t(0x9e3779b97f4a7c15ULL) + (seed << 6) + (seed >> 2));
+	}
+
+	inline size_t hashMember(const Value &element) noexcept { return hash(element); }
+	inline size_t hashMember(const std::pair<const String, Value> &member) noexcept
+	{
+		return hashCombine(std::hash<String>()(member.first), hash(member.second));
+	}
+
+	//! hash of an array/object node, computed once and then kept on it
+	template <typename T>
+	size_t hashNode(const Node<T> &node, Type type) noexcept
+	{
+		size_t seed = node.hash.load(std::memory_order_relaxed);
+		if (seed)
+			return seed;
+		seed = hashCombine(type, node.data.size());
+		for (const auto &member : node.data) // std::map keeps keys ordered, so equal objects hash in the same order
+			seed = hashCombine(seed, hashMember(member));
+		if (!seed)
+			seed = 1; // 0 means not computed yet
+		node.hash.store(seed, std::memory_order_relaxed);
+		return seed;
+	}
+
+	size_t hash(const Value &value) noexcept
+	{
+		switch (value.type)
+		{
+		case Type::string:
+			return hashCombine(Type::string, std::hash<String>()(*value.data_string));
+		case Type::number:
+			// -0.0 == 0.0, so both must hash alike
+			return hashCombine(Type::number, std::hash<Number>()(value.data_number == 0 ? 0.0 : value.data_number));
+		case Type::boolean:
+			return hashCombine(Type::boolean, value.data_boolean);
+		case Type::array:
+			return hashNode(*value.data_array, Type::array);
+		case Type::object:
+			return hashNode(*value.data_object, Type::object);
+		default:
+			return hashCombine(Type::null, 0);
+		}
+	}
+
+	template <typename T>
+	bool equalNodes(const Node<T> &left, const Node<T> &right) noexcept
+	{
+		if (&left == &right)
+			return true;
+		size_t leftHash = left.hash.load(std::memory_order_relaxed);
+		size_t rightHash = right.hash.load(std::memory_order_relaxed);
+		if (leftHash && rightHash && leftHash != rightHash)
+			return false;
+		return left.data == right.data;
+	}
+
+	bool operator==(const Value &left, const Value &right) noexcept
+	{
+		if (left.type != right.type)
+			return false;
+		switch (left.type)
+		{
+		case Type::string:
+			return left.data_string == right.data_string || *left.data_string == *right.data_string;
+		case Type::number:
+			return left.data_number == right.data_number;
+		case Type::boolean:
+			return left.data_boolean == right.data_boolean;
+		case Type::array:
+			return equalNodes(*left.data_array, *right.data_array);
+		case Type::object:
+			return equalNodes(*left.data_object, *right.data_object);
+		default:
+			return true;
 		}
-		rst.erase(rst.length() - 1, 1);
-		rst.append(indent ? "\n}" : "}");
-		return rst;
 	}
 }
@@ -3,11 +3,16 @@
 #include <cstring>
 #include <map>
 #include <vector>
+#include <memory>
+#include <functional>
 #include <exception>
 #include <cctype>
 #include <cstddef>
 #include <utility>
 #include <stdexcept>
+#include <charconv>
+#include <algorithm>
+#include <atomic>
 #include "./json-utils.cpp"
 
 namespace JSON
@@ -26,6 +31,45 @@ namespace JSON
 		explicit SyntaxError(const char *_Message) : _Mybase(_Message) {}
 	};
 
+	//! Error codes for the non-throwing parse API
+	enum ErrorCode
+	{
+		none,
+		unexpected_end,
+		unexpected_token,
+		bad_control_character,
+		invalid_unicode_escape,
+		expect_colon,
+		number_out_of_range,
+		invalid_utf8,
+		depth_limit_exceeded,
+		size_limit_exceeded,
+	};
+
+	struct ParseError
+	{
+		ErrorCode code = ErrorCode::none;
+		size_t position = 0; // byte offset in the input
+		size_t line = 0;	 // 1-based, filled in by tryParse
+		size_t column = 0;	 // 1-based, filled in by tryParse
+		char token = '\0';	 // offending character, if any
+
+		explicit operator bool() const noexcept { return code != ErrorCode::none; }
+		// the message is only formatted when asked for, rejecting input stays cheap
+		std::string message() const;
+	};
+
+	//! Limits and checks applied while parsing
+	struct ParseOptions
+	{
+		// deepest nesting of arrays and objects, 0 for no limit. only parsing and destroying a Value never recurse,
+		// stringify, hash, == and Query on a Value use one stack frame per level and can overflow on very deep input
+		size_t max_depth = 1024;
+		size_t max_size = 0;		// longest accepted input in bytes, 0 for no limit
+		bool validate_utf8 = false; // reject input which is not valid UTF-8
+		bool hash_containers = false; // hash every array/object as it closes, so JSON::hash of the result is O(1)
+	};
+
 	enum Type
 	{
 		number,
@@ -36,6 +80,43 @@ namespace JSON
 		object,
 	};
 
+	//! serialized form of a node, kept for stringifyCached
+	struct StringifyCache
+	{
+		unsigned int indent = 0;
+		bool ensure_ascii = false;
+		unsigned int depth = 0; // only matters when indenting
+		std::string bytes;
+	};
+
+	//! whether node is held by ptr alone, so its only owner may empty it.
+	// use_count is a relaxed load: the fence orders whatever the other owners read before letting go (their
+	// release decrement) ahead of the writes that follow, otherwise a reader on another thread would race with them
+	template <typename T>
+	inline bool isSoleOwner(const std::shared_ptr<T> &ptr) noexcept
+	{
+		if (!ptr || ptr.use_count() != 1)
+			return false;
+		std::atomic_thread_fence(std::memory_order_acquire);
+		return true;
+	}
+
+	//! immutable array/object node shared between Value copies
+	template <typename T>
+	struct Node
+	{
+		T data;
+		// filled lazily and read/written with std::atomic_load/store, so snapshots can be serialized from any thread.
+		// nodes never change, a mutation builds new nodes along its path which start without a cache
+		mutable std::shared_ptr<const StringifyCache> cache;
+		// structural hash of data, 0 until JSON::hash computes it. Any thread may fill it, all get the same number
+		mutable std::atomic<size_t> hash{0};
+
+		Node() = default;
+		explicit Node(T &&_data) : data(std::move(_data)) {}
+		~Node();
+	};
+
 	class Value
 	{
 	private:
@@ -48,12 +129,21 @@ namespace JSON
 		Type type = Type::null;
 
 		//! init data
+		// strings, arrays and objects live in immutable nodes shared between copies,
+		// so copying a Value is O(1) and a snapshot can be read from any thread without locks
 		Number data_number = 0;
 		Boolean data_boolean = false;
 		Null data_null = nullptr;
-		String data_string;
-		Array data_array;
-		Object data_object;
+		std::shared_ptr<const String> data_string;
+		std::shared_ptr<const Node<Array>> data_array;
+		std::shared_ptr<const Node<Object>> data_object;
+
+		template <typename T>
+		friend struct Node;
+		friend struct ParseStack;
+		friend void stringifyValue(String &out, const Value &value, unsigned int indent, bool ensure_ascii, unsigned int depth, bool cached);
+		friend size_t hash(const Value &value) noexcept;
+		friend bool operator==(const Value &left, const Value &right) noexcept;
 
 	public:
 		explicit Value() noexcept {};
@@ -64,15 +154,25 @@ namespace JSON
 		explicit Value(String &&_string) noexcept { setString(std::move(_string)); };
 		explicit Value(Array &&_array) noexcept { setArray(std::move(_array)); };
 		explicit Value(Object &&_object) noexcept { setObject(std::move(_object)); };
-		Value(const Value &val) noexcept
+		Value(const Value &val) noexcept = default;
+		Value(Value &&val) noexcept
+			: type(val.type), data_number(val.data_number), data_boolean(val.data_boolean), data_null(val.data_null),
+			  data_string(std::move(val.data_string)), data_array(std::move(val.data_array)), data_object(std::move(val.data_object))
+		{
+			val.type = Type::null; // a moved-from Value is null rather than an array without its node
+		}
+		Value &operator=(const Value &val) noexcept = default;
+		Value &operator=(Value &&val) noexcept
 		{
-			this->type = val.type;
-			this->data_number = val.data_number;
-			this->data_boolean = val.data_boolean;
-			this->data_null = val.data_null;
-			this->data_string = val.data_string;
-			this->data_array = val.data_array;
-			this->data_object = val.data_object;
+			type = val.type;
+			data_number = val.data_number;
+			data_boolean = val.data_boolean;
+			data_null = val.data_null;
+			data_string = std::move(val.data_string);
+			data_array = std::move(val.data_array);
+			data_object = std::move(val.data_object);
+			val.type = Type::null;
+			return *this;
 		}
 
 		//! getters
@@ -98,19 +198,39 @@ namespace JSON
 		{
 			if (type != Type::string)
 				throw TypeError(String("Expect string, got ") + getTypeString());
-			return data_string;
+			return *data_string;
 		}
 		inline Array getArray() const
 		{
 			if (type != Type::array)
 				throw TypeError(String("Expect array, got ") + getTypeString());
-			return data_array;
+			return data_array->data;
 		}
 		inline Object getObject() const
 		{
 			if (type != Type::object)
 				throw TypeError(String("Expect object, got ") + getTypeString());
-			return data_object;
+			return data_object->data;
+		}
+
+		//! read-only access without copying
+		inline const String &getStringRef() const
+		{
+			if (type != Type::string)
+				throw TypeError(String("Expect string, got ") + getTypeString());
+			return *data_string;
+		}
+		inline const Array &getArrayRef() const
+		{
+			if (type != Type::array)
+				throw TypeError(String("Expect array, got ") + getTypeString());
+			return data_array->data;
+		}
+		inline const Object &getObjectRef() const
+		{
+			if (type != Type::object)
+				throw TypeError(String("Expect object, got ") + getTypeString());
+			return data_object->data;
 		}
 
 		//! setters
@@ -129,27 +249,43 @@ namespace JSON
 			data_null = _null;
 			type = Type::null;
 		}
+		// nodes are created non-const, their sole owner (see isSoleOwner) may cast the const away to empty them
 		inline void setString(const char *_string) noexcept
 		{
-			data_string = String(_string);
+			data_string = std::make_shared<String>(_string);
 			type = Type::string;
 		}
 		inline void setString(String &&_string) noexcept
 		{
-			data_string = _string;
+			data_string = std::make_shared<String>(std::move(_string));
 			type = Type::string;
 		}
 		inline void setArray(Array &&_array) noexcept
 		{
-			data_array = _array;
+			data_array = std::make_shared<Node<Array>>(std::move(_array));
 			type = Type::array;
 		}
 		inline void setObject(Object &&_object) noexcept
 		{
-			data_object = _object;
+			data_object = std::make_shared<Node<Object>>(std::move(_object));
 			type = Type::object;
 		}
 
+		//! persistent updates, return a new Value and leave this one untouched
+		// only the nodes on the path to the change are copied, everything else stays shared
+		Value set(const String &key, Value value) const;
+		Value set(size_t index, Value value) const;
+		Value push(Value value) const;
+		// path segments are object keys or array indexes, as used by simple-jq
+		Value setIn(const std::vector<String> &path, Value value) const;
+		Value pushIn(const std::vector<String> &path, Value value) const;
+
+		//! whether this holds an array/object node no other Value shares
+		inline bool isUniqueContainer() const noexcept
+		{
+			return isSoleOwner(data_array) || isSoleOwner(data_object);
+		}
+
 		//! type
 		inline Type getType() const noexcept { return this->type; }
 		inline std::string getTypeString() const
@@ -176,18 +312,9 @@ namespace JSON
 		//! free memory
 		void clear() noexcept
 		{
-			switch (type)
-			{
-			case Type::string:
-				data_string.clear();
-				break;
-			case Type::array:
-				data_array.clear();
-				break;
-			case Type::object:
-				data_object.clear();
-				break;
-			}
+			data_string.reset();
+			data_array.reset();
+			data_object.reset();
 			setNull(nullptr);
 		}
 	};
@@ -200,9 +327,119 @@ namespace JSON
 	using Array = std::vector<Value>;
 	using Object = std::map<std::string, Value>;
 
+	//! move out the children whose nodes are held by nobody else
+	inline void takeUniqueChildren(Array &items, std::vector<Value> &pending)
+	{
+		for (auto &item : items)
+			if (item.isUniqueContainer())
+				pending.push_back(std::move(item));
+	}
+	inline void takeUniqueChildren(Object &items, std::vector<Value> &pending)
+	{
+		for (auto &item : items)
+			if (item.second.isUniqueContainer())
+				pending.push_back(std::move(item.second));
+	}
+
+	//! tear the subtree down from a worklist, a deeply nested tree would overflow the stack with recursive destructors
+	template <typename T>
+	Node<T>::~Node()
+	{
+		std::vector<Value> pending;
+		takeUniqueChildren(data, pending);
+		while (!pending.empty())
+		{
+			Value value = std::move(pending.back());
+			pending.pop_back();
+			// value holds the only reference, so its node is about to go and may be emptied first
+			if (value.data_array)
+				takeUniqueChildren(const_cast<Node<Array> &>(*value.data_array).data, pending);
+			else if (value.data_object)
+				takeUniqueChildren(const_cast<Node<Object> &>(*value.data_object).data, pending);
+		}
+	}
+
+	//! Explicit container stack of the parser, takes the place of recursion.
+	// It also keeps the emptied storage of earlier results (see JSON::Parser), taken before allocating anything new
+	struct ParseStack
+	{
+		std::string kinds;									// '[' or '{' for every open container, one byte per level
+		std::vector<Value *> slots;							// where each open container goes once closed, only when building
+		std::vector<std::shared_ptr<Node<Array>>> arrays;	// open arrays, innermost last
+		std::vector<std::shared_ptr<Node<Object>>> objects; // open objects, innermost last
+		String key;											// scratch buffer for object keys
+		Value duplicate;									// sink for the value of a repeated key
+
+		std::vector<std::shared_ptr<Node<Array>>> free_arrays;
+		std::vector<std::shared_ptr<Node<Object>>> free_objects;
+		std::vector<Object::node_type> free_entries; // map nodes, keeping the capacity of their key
+		std::vector<std::shared_ptr<String>> free_strings;
+		std::vector<Value> reclaiming; // worklist of reclaim
+
+		void clear() noexcept;
+		void openContainer(char kind, Value *slot);
+		void closeContainer(bool hashing) noexcept;
+		Value *appendElement();
+		Value *insertMember(); // under the name in key, a duplicate key keeps its first value
+		std::shared_ptr<String> newString();
+		void setString(Value &target, std::shared_ptr<String> &&string) noexcept;
+		// take the nodes of value which nobody else holds into the free lists
+		void reclaim(Value &value) noexcept;
+	};
+
+	//! Result of the non-throwing parse, holds either a value or an error
+	class ParseResult
+	{
+	public:
+		Value value;
+		ParseError error;
+
+		explicit operator bool() const noexcept { return !error; }
+	};
+
+	//! Long-lived parser for many small, similar messages.
+	// Each parse reuses the nodes, strings and container capacity of the previous result,
+	// so once warm it parses messages of a familiar shape without touching the heap
+	class Parser
+	{
+	public:
+		ParseOptions options;
+
+		explicit Parser(const ParseOptions &_options = ParseOptions()) noexcept : options(_options) {}
+		// the result lives until the next call, nodes still referenced by copies of it are not reused
+		const ParseResult &tryParse(const std::string &str) noexcept;
+		const Value &parse(const std::string &str);
+		inline const ParseResult &result() const noexcept { return current; }
+		// drop the current result but keep its memory for the next parse
+		void reset() noexcept;
+
+	private:
+		ParseResult current;
+		ParseStack stack;
+	};
+
 	//! JSON::parse
-	Value parse(const std::string &str);
+	Value parse(const std::string &str, const ParseOptions &options = ParseOptions());
+	ParseResult tryParse(const std::string &str, const ParseOptions &options = ParseOptions()) noexcept;
+	// checks the grammar without building a Value. UTF-8 is always checked, whatever options.validate_utf8 says,
+	// so it accepts exactly what parse accepts with validate_utf8 set
+	bool validate(const std::string &str, const ParseOptions &options = ParseOptions()) noexcept;
+	bool validate(const std::string &str, ParseError &error, const ParseOptions &options = ParseOptions()) noexcept;
 	void skipBlank(const std::string &str, size_t &i);
+	// a null output pointer only checks the input
+	bool scanValue(const std::string &str, size_t &i, Value *value, ParseError &error, const ParseOptions &options, size_t depth) noexcept;
+	bool scanString(const std::string &str, size_t &i, String *result, ParseError &error) noexcept;
+	bool scanNumber(const std::string &str, size_t &i, Number *result, ParseError &error) noexcept;
+	bool scanValue(const std::string &str, size_t &i, Value *value, ParseError &error, const ParseOptions &options, size_t depth, ParseStack &stack) noexcept;
+	bool parseValue(const std::string &str, size_t &i, Value &value, ParseError &error) noexcept;
+	bool parseString(const std::string &str, size_t &i, String &result, ParseError &error) noexcept;
+	bool parseNull(const std::string &str, size_t &i, Null &result, ParseError &error) noexcept;
+	bool parseNumber(const std::string &str, size_t &i, Number &result, ParseError &error) noexcept;
+	bool parseTrue(const std::string &str, size_t &i, Boolean &result, ParseError &error) noexcept;
+	bool parseFalse(const std::string &str, size_t &i, Boolean &result, ParseError &error) noexcept;
+	bool parseObject(const std::string &str, size_t &i, Object &result, ParseError &error) noexcept;
+	bool parseArray(const std::string &str, size_t &i, Array &result, ParseError &error) noexcept;
+	// throwing variants, raise JSON::SyntaxError
 	Value parseValue(const std::string &str, size_t &i);
 	String parseString(const std::string &str, size_t &i);
 	Null parseNull(const std::string &str, size_t &i);
@@ -212,12 +449,74 @@ namespace JSON
 	Object parseObject(const std::string &str, size_t &i);
 	Array parseArray(const std::string &str, size_t &i);
 
+	//! Several dotted paths (like simple-jq's) compiled into one trie and evaluated together.
+	// A segment is an object key, an array index or * for every member/element, e.g. "items.*.id"
+	class Query
+	{
+	public:
+		// called for each match with the index of the path, the concrete path and the value;
+		// in document order when run on text (a repeated key matches every time), key order when run on a Value
+		using Emit = std::function<void(size_t path, const String &at, const Value &value)>;
+
+		explicit Query(const std::vector<String> &paths);
+		// one pass over the text: only matched values are built, everything else is skipped without allocating
+		bool run(const std::string &str, const Emit &emit, ParseError &error, const ParseOptions &options = ParseOptions()) const;
+		void run(const Value &value, const Emit &emit) const;
+		static std::vector<String> splitPath(const String &path);
+
+	private:
+		static const size_t no_node = size_t(-1);
+		struct TrieNode
+		{
+			std::map<String, size_t> children;
+			size_t wildcard = no_node;
+			std::vector<size_t> paths; // paths ending here
+		};
+		std::vector<TrieNode> nodes;
+
+		void step(const std::vector<size_t> &states, const String &segment, std::vector<size_t> &next) const;
+		bool walk(const std::string &str, size_t &i, const std::vector<size_t> &states, String &at, const Emit &emit, ParseError &error, const ParseOptions &options, size_t depth, ParseStack &stack) const;
+		void match(const Value &value, const std::vector<size_t> &states, String &at, const Emit &emit) const;
+	};
+
 	//! JSON::stringify
-	String stringify(const Value &value, unsigned int indent = 0);
-	String stringifyArray(const Array &value, unsigned int indent = 0);
-	String stringifyObject(const Object &value, unsigned int indent = 0);
+	// ensure_ascii escapes every non-ASCII char as \uXXXX (surrogate pairs above U+FFFF)
+	String stringify(const Value &value, unsigned int indent = 0, bool ensure_ascii = false);
+	String stringifyArray(const Array &value, unsigned int indent = 0, bool ensure_ascii = false);
+	String stringifyObject(const Object &value, unsigned int indent = 0, bool ensure_ascii = false);
+	// same output as stringify, but keeps the output of every sizable array/object on its node and reuses it
+	// next time, so after a few setIn/pushIn only the nodes on the changed paths are serialized again
+	String stringifyCached(const Value &value, unsigned int indent = 0, bool ensure_ascii = false);
+	// appending variants, write straight into out at the given nesting depth
+	void stringifyValue(String &out, const Value &value, unsigned int indent, bool ensure_ascii, unsigned int depth, bool cached = false);
+	void stringifyArray(String &out, const Array &value, unsigned int indent, bool ensure_ascii, unsigned int depth, bool cached = false);
+	void stringifyObject(String &out, const Object &value, unsigned int indent, bool ensure_ascii, unsigned int depth, bool cached = false);
+	void stringifyString(String &out, const String &value, bool ensure_ascii = false);
 	inline String stringifyBoolean(const Boolean &value) { return value ? String("true") : String("false"); }
 	inline String stringifyNull(const Null &value) { return String("null"); }
 	inline String stringifyNumber(const Number &value) { return std::to_string(value); }
-	inline String stringifyString(const String &value) { return String("\"") + replaceAllDistinct(value, "\"", "\\\"") + String("\""); }
+	inline String stringifyString(const String &value, bool ensure_ascii = false)
+	{
+		String out;
+		stringifyString(out, value, ensure_ascii);
+		return out;
+	}
+
+	//! JSON::hash
+	// structural hash, equal values hash alike whatever way they were built. Arrays and objects keep theirs
+	// on the node, so hashing again is O(1) and after setIn/pushIn only the changed paths are hashed again
+	size_t hash(const Value &value) noexcept;
+	// deep comparison, shared nodes compare equal at once and two hashed nodes with different hashes unequal at once
+	bool operator==(const Value &left, const Value &right) noexcept;
+	inline bool operator!=(const Value &left, const Value &right) noexcept { return !(left == right); }
+}
+
+// lets Value be the key of std::unordered_map/std::unordered_set
+namespace std
+{
+	template <>
+	struct hash<JSON::Value>
+	{
+		size_t operator()(const JSON::Value &value) const noexcept { return JSON::hash(value); }
+	};
 }
@@ -8,9 +8,9 @@ int main()
     try
     {
         // to echo string below, ensure you are using correct encoding
-        cout << JSON::parse(R"JSON( "\\u4f60\\u597d\\uff0c\\u4e16\\u754c\\uff01" )JSON").getString() << endl;
-        cout << JSON::parse(R"JSON( "\a" )JSON").getString() << endl; // this is ok, but \n will cause error
-        cout << JSON::parse(R"JSON( "break\\nline" )JSON").getString() << endl;
+        cout << JSON::parse(R"JSON( "\u4f60\u597d\uff0c\u4e16\u754c\uff01" )JSON").getString() << endl;
+        cout << JSON::parse(R"JSON( "a\/b\\c" )JSON").getString() << endl; // a/b\c, but \a or a raw newline will cause error
+        cout << JSON::parse(R"JSON( "break\nline" )JSON").getString() << endl;
 
         cout << JSON::parse("-9.9E+9").getNumber() << endl;
         cout << JSON::parse("-9.9E-9").getNumber() << endl;
@@ -47,6 +47,67 @@ int main()
         auto vec = JSON::Value({JSON::Value(true), JSON::Value("abc"), JSON::Value(JSON::Array{JSON::Value(12.3)})});
         cout << JSON::stringify(vec, 4) << endl;
 
+        auto updated = obj.setIn({"b", "c"}, JSON::Value(4.0)); // copies only obj and obj.b, "a" stays shared
+        cout << JSON::stringify(obj) << endl;     // {"a":1.000000,"b":{"c":3.000000}}
+        cout << JSON::stringify(updated) << endl; // {"a":1.000000,"b":{"c":4.000000}}
+        cout << (JSON::stringifyCached(updated, 4) == JSON::stringify(updated, 4)) << endl; // 1, same bytes as stringify
+
+        auto config = JSON::parse(R"JSON({"db": {"host": "primary.example.com", "port": 5432, "replicas": ["replica-1.example.com", "replica-2.example.com", "replica-3.example.com"]},
+                                          "tags": ["alpha", "beta", "gamma", "delta", "epsilon", "zeta", "eta", "theta", "iota", "kappa"]})JSON");
+        JSON::stringifyCached(config), JSON::stringifyCached(config, 4); // keeps the output of "db", "db.replicas" and "tags"
+        auto db = config.getObjectRef().at("db");
+        config = config.setIn({"db", "port"}, JSON::Value(6432.0)).pushIn({"tags"}, JSON::Value("lambda")).set("archive", JSON::Value(JSON::Object{{"db", db}}));
+        cout << (JSON::stringifyCached(config) == JSON::stringify(config)) << (JSON::stringifyCached(config, 4) == JSON::stringify(config, 4)) << endl; // 11, also for the old "db" one level deeper
+
+        auto result = JSON::tryParse("[1,\n x]"); // never throws
+        if (!result)
+            cout << result.error.message() << " (line " << result.error.line << ", column " << result.error.column << ")" << endl; // Unexpected token x in JSON at position 5 (line 2, column 2)
+
+        auto escaped = JSON::Value("tab\there \"quoted\" \u00e9");
+        cout << JSON::stringify(escaped) << endl;       // "tab\there \"quoted\" é"
+        cout << JSON::stringify(escaped, 0, true) << endl; // "tab\there \"quoted\" \u00e9"
+        auto tricky = JSON::Value("quote\" backslash\\ C:\\new\\table \x01\b\f\r\n\t \u00e9 \U0001F600");
+        cout << (JSON::parse(JSON::stringify(tricky)) == tricky) << (JSON::parse(JSON::stringify(tricky, 0, true)) == tricky) << endl; // 11, stringify and parse round trip
+        cout << bool(JSON::tryParse(R"("\ud800")")) << bool(JSON::tryParse(R"("\udc00")")) << bool(JSON::tryParse(R"("\ud800\u0041")"))
+             << JSON::validate(R"("\ud800")") << bool(JSON::tryParse(R"("\ud83d\ude00")")) << endl; // 00001, unpaired surrogates are rejected, pairs are one code point
+
+        JSON::Parser parser; // keeps its memory between messages
+        for (auto message : {R"JSON({"id": 1, "ok": true})JSON", R"JSON({"id": 2, "ok": false})JSON"})
+            cout << JSON::stringify(parser.parse(message)) << endl; // {"id":1.000000,"ok":true} then {"id":2.000000,"ok":false}
+
+        JSON::Value left = JSON::parse(R"JSON({"a": [1, 2], "b": -0})JSON"), right = JSON::parse(R"JSON({"b": 0, "a": [1, 2]})JSON");
+        cout << (left == right) << (JSON::hash(left) == JSON::hash(right)) << endl; // 11, also usable as a std::unordered_map key
+
+        JSON::ParseError error;
+        JSON::Query query({"items.*.id", "items.0.name"}); // one pass for every path
+        query.run(R"JSON({"items": [{"id": 1, "name": "a"}, {"id": 2}]})JSON", [](size_t path, const JSON::String &at, const JSON::Value &value)
+                  { cout << path << " " << at << " " << JSON::stringify(value) << endl; }, error); // 0 items.0.id 1.000000, 1 items.0.name "a", 0 items.1.id 2.000000
+
+        JSON::ParseOptions options;
+        options.max_depth = 2;
+        cout << JSON::validate(R"JSON( {"a": [1, 2]} )JSON") << endl; // 1, nothing is allocated
+        if (!JSON::validate("[[[1]]]", error, options))
+            cout << error.message() << endl; // Maximum nesting depth exceeded in JSON at position 2
+        if (!JSON::validate("\"\xff\"", error))
+            cout << error.message() << endl; // Invalid UTF-8 sequence in JSON at position 1
+        JSON::ParseOptions unlimited;
+        unlimited.max_depth = 0;
+        std::string deep = std::string(300000, '[') + std::string(300000, ']');
+        cout << bool(JSON::tryParse(deep, unlimited)) << bool(JSON::Parser(unlimited).tryParse(deep)) << endl; // 11, parsing and freeing do not recurse
+        cout << JSON::tryParse(deep).error.message() << endl;                                                  // Maximum nesting depth exceeded in JSON at position 1024
+        try
+        {
+            JSON::parse(deep);
+        }
+        catch (const JSON::SyntaxError &e)
+        {
+            cout << e.what() << endl; // the same, from parse
+        }
+        for (auto text : {std::string("01"), std::string("-01"), std::string("\"a\tb\""), std::string("\"a\x01\""), std::string("\"a\0\"", 4)})
+            cout << JSON::validate(text) << bool(JSON::tryParse(text)); // 00 for each: no leading zeros, no raw control chars in strings
+        cout << endl;
+        cout << JSON::tryParse("\"a\tb\"").error.message() << endl; // Bad control character in string literal in JSON at position 2
+
         cout << JSON::parse("'").getTypeString() << endl; // throw error
     }
     catch (JSON::SyntaxError e)